@@ -0,0 +1,277 @@
+// Benchmark: syscalls per move and move latency of the matchmaking server,
+// epoll workers versus io_uring workers. Starts the given server binary, has
+// each client thread play scripted games against it back to back, and reports
+// the round trip of every message together with the server's own count of
+// worker syscalls per move, read from its metrics line.
+//
+// Build the two servers with a short metrics interval, then the benchmark:
+//   gcc -O2 -DMATCHMAKING -DMETRICS_INTERVAL_SEC=1 -o hw4_epoll src/hw4.c -lpthread
+//   gcc -O2 -DMATCHMAKING -DUSE_IO_URING -DMETRICS_INTERVAL_SEC=1 -o hw4_uring src/hw4.c -lpthread
+//   gcc -O2 -o bench_io src/bench_io.c -lpthread
+// Run: ./bench_io ./hw4_epoll [clients] [games per client]
+#define HW4_NO_MAIN
+#include "hw4.c"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define MOVES_PER_GAME 45
+#define METRICS_WAIT_SEC 15
+
+typedef struct
+{
+    pthread_t thread;
+    int games;
+    long *latency_ns;
+    int samples;
+    int failed;
+} Client;
+
+static pthread_mutex_t connect_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long server_syscalls, server_moves;
+static int metrics_seen;
+
+const char *placement = "I 1 1 0 0 1 1 0 2 1 1 0 4 1 1 2 2 1 1 2 0";
+
+long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int connect_port(int port)
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one message and waits for its reply, recording the round trip.
+int exchange(Client *client, int fd, const char *message, char *reply)
+{
+    long start = now_ns();
+    if (send(fd, message, strlen(message), MSG_NOSIGNAL) < 0)
+    {
+        return -1;
+    }
+    int nbytes = recv(fd, reply, BUFFER_SIZE - 1, 0);
+    if (nbytes <= 0)
+    {
+        return -1;
+    }
+    reply[nbytes] = '\0';
+    client->latency_ns[client->samples++] = now_ns() - start;
+    return 0;
+}
+
+int play_game(Client *client)
+{
+    char reply[BUFFER_SIZE];
+    char message[32];
+    int fds[2];
+
+    // Connecting both players under one lock keeps the two lobbies in the same
+    // order, so the server pairs this thread's two sockets with each other
+    pthread_mutex_lock(&connect_lock);
+    fds[0] = connect_port(PORT1);
+    fds[1] = connect_port(PORT2);
+    pthread_mutex_unlock(&connect_lock);
+
+    int ok = fds[0] >= 0 && fds[1] >= 0 &&
+             exchange(client, fds[0], "B 10 10", reply) == 0 && exchange(client, fds[1], "B", reply) == 0 &&
+             exchange(client, fds[0], placement, reply) == 0 && exchange(client, fds[1], placement, reply) == 0;
+
+    // Player 1 sinks the 20 cells of the placement while player 2 misses along rows 8 and 9
+    for (int shot = 0; ok && shot < 20; shot++)
+    {
+        int row = shot < 16 ? shot / 4 : 4 + (shot - 16) / 2;
+        int col = shot < 16 ? shot % 4 : (shot - 16) % 2;
+        sprintf(message, "S %d %d", row, col);
+        ok = exchange(client, fds[0], message, reply) == 0 && reply[0] == 'R';
+        if (ok && strncmp(reply, "R 0", 3) == 0)
+        {
+            break;
+        }
+        sprintf(message, "S %d %d", 8 + shot / 10, shot % 10);
+        ok = ok && exchange(client, fds[1], message, reply) == 0 && reply[0] == 'R';
+    }
+
+    // Winner, then loser, send one more message to get the result
+    ok = ok && exchange(client, fds[0], "S 0 0", reply) == 0 && strcmp(reply, "H 1") == 0 &&
+         exchange(client, fds[1], "S 0 0", reply) == 0 && strcmp(reply, "H 0") == 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    return ok ? 0 : -1;
+}
+
+void *client_main(void *arg)
+{
+    Client *client = arg;
+    for (int game = 0; game < client->games; game++)
+    {
+        client->failed += play_game(client) < 0;
+    }
+    return NULL;
+}
+
+// Reads the server's log so it never blocks on a full pipe, keeping the
+// counters from the latest metrics line.
+void *drain_server(void *arg)
+{
+    FILE *out = arg;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), out) != NULL)
+    {
+        unsigned long syscalls, moves;
+        char *counters = strstr(line, "worker_syscalls=");
+        if (counters != NULL && sscanf(counters, "worker_syscalls=%lu moves=%lu", &syscalls, &moves) == 2)
+        {
+            pthread_mutex_lock(&metrics_lock);
+            server_syscalls = syscalls;
+            server_moves = moves;
+            metrics_seen++;
+            pthread_mutex_unlock(&metrics_lock);
+        }
+    }
+    return NULL;
+}
+
+// Waits for a metrics line that covers at least moves moves. Returns -1 on timeout.
+int wait_for_metrics(unsigned long moves, int after, unsigned long *syscalls)
+{
+    for (int tries = 0; tries < METRICS_WAIT_SEC * 10; tries++)
+    {
+        pthread_mutex_lock(&metrics_lock);
+        int done = metrics_seen > after && server_moves >= moves;
+        *syscalls = server_syscalls;
+        pthread_mutex_unlock(&metrics_lock);
+        if (done)
+        {
+            return 0;
+        }
+        usleep(100000);
+    }
+    return -1;
+}
+
+int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s server [clients] [games per client]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int client_count = argc > 2 ? atoi(argv[2]) : 16;
+    int games = argc > 3 ? atoi(argv[3]) : 50;
+    if (client_count < 1 || games < 1)
+    {
+        fprintf(stderr, "clients and games must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    int out_pipe[2];
+    if (pipe(out_pipe) < 0)
+    {
+        perror("pipe failed");
+        return EXIT_FAILURE;
+    }
+    pid_t server = fork();
+    if (server < 0)
+    {
+        perror("fork failed");
+        return EXIT_FAILURE;
+    }
+    if (server == 0)
+    {
+        dup2(out_pipe[1], STDOUT_FILENO);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        execl(argv[1], argv[1], (char *)NULL);
+        perror("exec failed");
+        _exit(EXIT_FAILURE);
+    }
+    close(out_pipe[1]);
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drain_server, fdopen(out_pipe[0], "r"));
+
+    // The first metrics line means the server is up and its counters start at zero
+    unsigned long syscalls = 0;
+    if (wait_for_metrics(0, 0, &syscalls) < 0)
+    {
+        fprintf(stderr, "no metrics from %s; was it built with -DMATCHMAKING?\n", argv[1]);
+        kill(server, SIGTERM);
+        return EXIT_FAILURE;
+    }
+
+    Client *clients = calloc(client_count, sizeof(Client));
+    long start = now_ns();
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i].games = games;
+        clients[i].latency_ns = malloc(sizeof(long) * games * MOVES_PER_GAME);
+        pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+    }
+
+    long *latency_ns = malloc(sizeof(long) * client_count * games * MOVES_PER_GAME);
+    int samples = 0, failed = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        memcpy(latency_ns + samples, clients[i].latency_ns, sizeof(long) * clients[i].samples);
+        samples += clients[i].samples;
+        failed += clients[i].failed;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    pthread_mutex_lock(&metrics_lock);
+    int seen = metrics_seen;
+    pthread_mutex_unlock(&metrics_lock);
+    int counted = wait_for_metrics(samples, seen, &syscalls) == 0;
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+
+    qsort(latency_ns, samples, sizeof(long), compare_long);
+    printf("%s: %d clients x %d games, %d moves in %.2f s (%.0f moves/s), %d games failed\n",
+           argv[1], client_count, games, samples, seconds, samples / seconds, failed);
+    if (counted)
+    {
+        printf("worker syscalls per move: %.2f\n", (double)syscalls / samples);
+    }
+    else
+    {
+        printf("worker syscalls per move: n/a (no metrics line after the run)\n");
+    }
+    if (samples > 0)
+    {
+        printf("move latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               latency_ns[samples / 2] / 1e3, latency_ns[samples * 90L / 100] / 1e3,
+               latency_ns[samples * 99L / 100] / 1e3, latency_ns[samples * 999L / 1000] / 1e3,
+               latency_ns[samples - 1] / 1e3);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
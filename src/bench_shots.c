@@ -0,0 +1,137 @@
+// Benchmark: resolving shots through the ship-id table (fire_shot) versus the
+// original approach of negating the hit cell and scanning the whole board for
+// the ship id to detect a sink.
+//
+// Build: gcc -O2 -o bench_shots src/bench_shots.c
+// Board is MAX_SIZE x MAX_SIZE with PIECE_COUNT square pieces, every one of
+// which is sunk each round; override with -DPIECE_COUNT=n (1 to 63).
+#ifndef PIECE_COUNT
+#define PIECE_COUNT 32
+#endif
+#define HW4_NO_MAIN
+#include "hw4.c"
+
+#include <time.h>
+
+#define ROUNDS 2000
+
+typedef struct
+{
+    int cells[MAX_SIZE][MAX_SIZE];
+    int ships_remaining;
+} ScanBoard;
+
+// The pre-table shot resolution, kept here for comparison.
+ShotResult scan_fire_shot(ScanBoard *board, int row, int col, int width, int height)
+{
+    int cell = board->cells[row][col];
+
+    if (cell < 0 || cell == 'M')
+    {
+        return SHOT_REPEAT;
+    }
+    if (cell == 0)
+    {
+        board->cells[row][col] = 'M';
+        return SHOT_MISS;
+    }
+
+    board->cells[row][col] = -cell;
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            if (board->cells[i][j] == cell)
+            {
+                return SHOT_HIT;
+            }
+        }
+    }
+    board->ships_remaining--;
+    return SHOT_SUNK;
+}
+
+double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+int main()
+{
+    static int layout[MAX_SIZE][MAX_SIZE];
+    static int order[MAX_SIZE * MAX_SIZE];
+    int pieces[PIECE_COUNT][4];
+    int cell_count = MAX_SIZE * MAX_SIZE;
+
+    // Square pieces (shape 1) tiled from the top-left corner, one id each, so
+    // every ship has four cells; the rest of the board is water.
+    precomputeRotations();
+    PlayerBoard placed;
+    reset_board(&placed);
+    for (int i = 0; i < PIECE_COUNT; i++)
+    {
+        pieces[i][0] = 1;
+        pieces[i][1] = 1;
+        pieces[i][2] = i % (MAX_SIZE / 2) * 2;
+        pieces[i][3] = i / (MAX_SIZE / 2) * 2;
+        place_ship(&placed, pieces[i], i + 1);
+    }
+    for (int i = 0; i < cell_count; i++)
+    {
+        layout[i / MAX_SIZE][i % MAX_SIZE] = placed.cells[i / MAX_SIZE][i % MAX_SIZE] & CELL_SHIP_MASK;
+        order[i] = i;
+    }
+    srand(220);
+    for (int i = cell_count - 1; i > 0; i--)
+    {
+        int j = rand() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    struct timespec start, end;
+    long table_sunk = 0, scan_sunk = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        PlayerBoard board;
+        reset_board(&board);
+        for (int i = 0; i < PIECE_COUNT; i++)
+        {
+            place_ship(&board, pieces[i], i + 1);
+        }
+        for (int i = 0; i < cell_count; i++)
+        {
+            table_sunk += fire_shot(&board, order[i] / MAX_SIZE, order[i] % MAX_SIZE) == SHOT_SUNK;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double table_ns = elapsed_ns(&start, &end) / ((double)ROUNDS * cell_count);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        ScanBoard board;
+        memcpy(board.cells, layout, sizeof(board.cells));
+        board.ships_remaining = PIECE_COUNT;
+        for (int i = 0; i < cell_count; i++)
+        {
+            scan_sunk += scan_fire_shot(&board, order[i] / MAX_SIZE, order[i] % MAX_SIZE, MAX_SIZE, MAX_SIZE) == SHOT_SUNK;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double scan_ns = elapsed_ns(&start, &end) / ((double)ROUNDS * cell_count);
+
+    printf("%dx%d board, %d pieces, %d shots per round, %d rounds\n", MAX_SIZE, MAX_SIZE, PIECE_COUNT, cell_count, ROUNDS);
+    printf("ship-id table: %8.1f ns/shot (setup included)\n", table_ns);
+    printf("board scan:    %8.1f ns/shot\n", scan_ns);
+    if (table_sunk != (long)ROUNDS * PIECE_COUNT || scan_sunk != table_sunk)
+    {
+        printf("mismatch: %ld sunk by the table, %ld by the scan, expected %ld\n",
+               table_sunk, scan_sunk, (long)ROUNDS * PIECE_COUNT);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+// Benchmark: rejection throughput of the validation layer under a flood of
+// adversarial commands. Each command goes through the same parse and validate
+// path as in the server; none of them may be accepted.
+//
+// Build: gcc -O2 -o bench_validate src/bench_validate.c
+#define HW4_NO_MAIN
+#include "hw4.c"
+
+#include <time.h>
+
+#define ITERATIONS 200000
+
+typedef struct
+{
+    const char *name;
+    char command[BUFFER_SIZE];
+} FloodCase;
+
+double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Fills a command with count copies of number, truncated to what one read can hold.
+void repeat_numbers(char *command, char prefix, const char *number, int count)
+{
+    int len = sprintf(command, "%c", prefix);
+    for (int i = 0; i < count && len + (int)strlen(number) + 2 < BUFFER_SIZE; i++)
+    {
+        len += sprintf(command + len, " %s", number);
+    }
+}
+
+const char *validate_command(const char *command, int width, int height)
+{
+    int args[MAX_ARGS];
+    int arg_count = parse_arguments(command + 1, args);
+
+    switch (command[0])
+    {
+    case 'B':
+        return validate_begin(1, args, arg_count);
+    case 'I':
+        return validate_init(args, arg_count, width, height);
+    case 'S':
+        return validate_shot(args, arg_count, width, height);
+    }
+    return "E 102";
+}
+
+int main()
+{
+    static FloodCase cases[] = {
+        {"oversized I", ""},
+        {"huge numbers", ""},
+        {"B out of range", "B 999999999999 5"},
+        {"I bad shape", "I 1 1 0 0 1 1 0 2 1 1 0 4 1 1 2 2 9 1 2 0"},
+        {"I overlap", "I 1 1 0 0 1 1 0 2 1 1 0 4 1 1 2 2 1 1 1 1"},
+        {"I off board", "I 1 1 0 0 1 1 0 2 1 1 0 4 1 1 2 2 1 1 9 9"},
+        {"S out of range", "S 10 23"},
+        {"S extra args", "S 1 2 3 4 5 6 7 8"},
+    };
+    int case_count = sizeof(cases) / sizeof(cases[0]);
+    int width = MIN_SIZE;
+    int height = MIN_SIZE;
+
+    precomputeRotations();
+    repeat_numbers(cases[0].command, 'I', "7", BUFFER_SIZE);
+    repeat_numbers(cases[1].command, 'S', "99999999999999999999", BUFFER_SIZE);
+
+    struct timespec start, end;
+    double total_ns = 0;
+    for (int c = 0; c < case_count; c++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ITERATIONS; i++)
+        {
+            if (validate_command(cases[c].command, width, height) == NULL)
+            {
+                printf("%s was accepted\n", cases[c].name);
+                return EXIT_FAILURE;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ns = elapsed_ns(&start, &end);
+        total_ns += ns;
+        printf("%-16s %5zu bytes %9.1f ns/reject\n", cases[c].name, strlen(cases[c].command), ns / ITERATIONS);
+    }
+    printf("mixed flood: %.2f M rejections/s\n", case_count * (double)ITERATIONS / total_ns * 1e3);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+// libFuzzer harness for the input validation layer. Raw bytes go through
+// parse_arguments and validate_begin/init/shot; whatever they accept is then
+// applied to a scratch board, which must stay within bounds and give every
+// piece as many cells as its shape has.
+//
+// Build with libFuzzer:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -o fuzz_validate src/fuzz_validate.c
+// Without clang, -DSTANDALONE_FUZZ adds a driver that replays the files given
+// on the command line, or random inputs when there are none:
+//   gcc -g -O1 -fsanitize=address,undefined -DSTANDALONE_FUZZ -o fuzz_validate src/fuzz_validate.c
+#define HW4_NO_MAIN
+#include "hw4.c"
+
+int shape_cells(int shape[SHIP_SIZE][SHIP_SIZE])
+{
+    int cells = 0;
+    for (int i = 0; i < SHIP_SIZE; i++)
+    {
+        for (int j = 0; j < SHIP_SIZE; j++)
+        {
+            cells += shape[i][j];
+        }
+    }
+    return cells;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static int initialized = 0;
+    if (!initialized)
+    {
+        precomputeRotations();
+        initialized = 1;
+    }
+    if (size < 3)
+    {
+        return 0;
+    }
+
+    // The first two bytes pick the board size the command is checked against
+    int width = MIN_SIZE + data[0] % (MAX_SIZE - MIN_SIZE + 1);
+    int height = MIN_SIZE + data[1] % (MAX_SIZE - MIN_SIZE + 1);
+    data += 2;
+    size -= 2;
+
+    // Same framing as the server: at most BUFFER_SIZE - 1 bytes, NUL-terminated
+    char buffer[BUFFER_SIZE] = {0};
+    if (size > BUFFER_SIZE - 1)
+    {
+        size = BUFFER_SIZE - 1;
+    }
+    memcpy(buffer, data, size);
+
+    int args[MAX_ARGS];
+    int arg_count = parse_arguments(buffer + 1, args);
+    int stored = arg_count < MAX_ARGS ? arg_count : MAX_ARGS;
+    for (int i = 0; i < stored; i++)
+    {
+        if (args[i] < 0)
+        {
+            __builtin_trap();
+        }
+    }
+
+    for (int player = 1; player <= 2; player++)
+    {
+        if (!validate_begin(player, args, arg_count) && player == 1 &&
+            (args[0] < MIN_SIZE || args[0] > MAX_SIZE || args[1] < MIN_SIZE || args[1] > MAX_SIZE))
+        {
+            __builtin_trap();
+        }
+    }
+
+    PlayerBoard board;
+    reset_board(&board);
+    if (!validate_init(args, arg_count, width, height))
+    {
+        int cells = 0;
+        for (int i = 0; i < PIECE_COUNT; i++)
+        {
+            place_ship(&board, &args[i * 4], i + 1);
+            // Rotations are generated at startup; they must not gain or lose cells
+            if (board.cells_left[i + 1] != shape_cells(ship_shapes[args[i * 4] - 1][0]))
+            {
+                __builtin_trap();
+            }
+        }
+        for (int i = 0; i < MAX_SIZE; i++)
+        {
+            for (int j = 0; j < MAX_SIZE; j++)
+            {
+                if (board.cells[i][j] != CELL_EMPTY && (i >= height || j >= width))
+                {
+                    __builtin_trap();
+                }
+                cells += board.cells[i][j] != CELL_EMPTY;
+            }
+        }
+        // Overlapping pieces would have been counted twice
+        for (int i = 1; i <= PIECE_COUNT; i++)
+        {
+            cells -= board.cells_left[i];
+        }
+        if (cells != 0)
+        {
+            __builtin_trap();
+        }
+    }
+
+    if (!validate_shot(args, arg_count, width, height))
+    {
+        if (args[0] >= height || args[1] >= width)
+        {
+            __builtin_trap();
+        }
+        fire_shot(&board, args[0], args[1]);
+    }
+    return 0;
+}
+
+#ifdef STANDALONE_FUZZ
+#define RANDOM_RUNS 1000000
+
+int main(int argc, char **argv)
+{
+    static uint8_t data[BUFFER_SIZE + 2];
+
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *fp = fopen(argv[i], "rb");
+        if (fp == NULL)
+        {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        size_t size = fread(data, 1, sizeof(data), fp);
+        fclose(fp);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    if (argc > 1)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    // Mostly digits and spaces so inputs get past the argument count checks
+    const char alphabet[] = "0123456789          BIS-";
+    srand(220);
+    for (int run = 0; run < RANDOM_RUNS; run++)
+    {
+        size_t size = 2 + rand() % 96;
+        data[0] = rand();
+        data[1] = rand();
+        data[2] = "BIS"[rand() % 3];
+        for (size_t i = 3; i < size; i++)
+        {
+            data[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        if (run % 2)
+        {
+            // Well-formed placements, so some get past the overlap check
+            size = 3;
+            for (int i = 0; i < PIECE_COUNT; i++)
+            {
+                size += sprintf((char *)data + size, " %d %d %d %d", 1 + rand() % NUM_SHAPES,
+                                1 + rand() % ROTATIONS, rand() % MAX_SIZE, rand() % MAX_SIZE);
+            }
+            data[2] = 'I';
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%d random inputs passed\n", RANDOM_RUNS);
+    return EXIT_SUCCESS;
+}
+#endif
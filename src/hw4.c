@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -7,16 +9,85 @@
 #include <sys/socket.h>
 #include <asm-generic/socket.h>
 
+#ifdef MATCHMAKING
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#endif
+
 #define PORT1 2201
 #define PORT2 2202
 #define BUFFER_SIZE 1024
 #define MAX_SIZE 24
+#ifndef PIECE_COUNT
 #define PIECE_COUNT 5
+#endif
 
 #define NUM_SHAPES 7
 #define ROTATIONS 4
 #define SHIP_SIZE 4
 
+// Concurrent matches share one terminal, so the pinned diff view only makes
+// sense for the single-match server
+#if defined(MATCHMAKING) && defined(ANSI_RENDER)
+#undef ANSI_RENDER
+#endif
+
+// The io_uring backend replaces the matchmaking workers' epoll loop; the
+// single-match server keeps its blocking reads
+#if defined(USE_IO_URING) && !defined(MATCHMAKING)
+#undef USE_IO_URING
+#endif
+
+#ifdef MATCHMAKING
+#define LISTEN_BACKLOG 64
+#define QUEUE_CAPACITY 256 // must be a power of two
+#define WORKER_COUNT 4
+#define ACCEPT_BACKOFF_US 100000
+#define MAX_EVENTS 64
+#ifndef METRICS_INTERVAL_SEC
+#define METRICS_INTERVAL_SEC 10
+#endif
+#define SOCKET_TIMEOUT_SEC 2
+#ifndef IDLE_TIMEOUT_SEC
+#define IDLE_TIMEOUT_SEC 60
+#endif
+#ifdef USE_IO_URING
+#define RING_ENTRIES 256
+#define RECV_BUFFERS 512 // provided receive buffers per worker
+#define RECV_BUFFER_SIZE (BUFFER_SIZE - 1)
+#define RECV_PAUSE 4 // queued messages before a connection stops receiving
+#endif
+#else
+#define LISTEN_BACKLOG 1
+#endif
+
+#define MIN_SIZE 10
+#define MAX_ARGS (PIECE_COUNT * 4)
+
+// Board cell encoding: 0 is open water, 1..PIECE_COUNT is the id of the ship
+// covering the cell, CELL_HIT is or'ed onto a ship id once it is struck.
+#define CELL_EMPTY 0
+#define CELL_MISS 0x40
+#define CELL_HIT 0x80
+#define CELL_SHIP_MASK 0x3F
+
+#if PIECE_COUNT > CELL_SHIP_MASK
+#error "PIECE_COUNT does not fit in the cell encoding"
+#endif
+
 typedef enum
 {
     STATE_BEGIN,
@@ -25,12 +96,74 @@ typedef enum
     STATE_DISCONNECTED
 } GameState;
 
-int *convert_to_int_array(const char *input_str, int *size);
+typedef enum
+{
+    SHOT_MISS,
+    SHOT_HIT,
+    SHOT_SUNK,
+    SHOT_REPEAT
+} ShotResult;
+
+// Per-player board. cells_left[id] counts the unhit cells of ship id so a
+// shot resolves with one lookup and one decrement instead of a board scan.
+typedef struct
+{
+    uint8_t cells[MAX_SIZE][MAX_SIZE];
+    uint8_t cells_left[PIECE_COUNT + 1];
+    int ships_remaining;
+} PlayerBoard;
+
+typedef enum
+{
+    PHASE_PLAYING,
+    PHASE_WINNER_ACK,
+    PHASE_LOSER_ACK,
+    PHASE_OVER
+} MatchPhase;
+
+// One game between two connections. The match only advances when the player
+// whose turn it is sends a message, so it can be driven by blocking reads or
+// by readiness events.
+typedef struct
+{
+    unsigned long id;
+    int conn_fds[2];
+    int board_width;
+    int board_height;
+    PlayerBoard game_boards[2];
+    GameState state[2];
+    MatchPhase phase;
+    int turn;
+    int winner;
+} Match;
+
+int parse_arguments(const char *input_str, int args[MAX_ARGS]);
+const char *validate_begin(int player, const int *args, int arg_count);
+const char *validate_init(const int *args, int arg_count, int width, int height);
+const char *validate_shot(const int *args, int arg_count, int width, int height);
 void send_response(int conn_fd, const char *response);
 int read_message(int conn_fd, char *buffer, int buffer_size);
+void match_init(Match *match, unsigned long id, int conn_fds[2]);
+void match_log(Match *match, const char *format, ...);
+void match_print_boards(Match *match);
+int match_step(Match *match, char *buffer, int nbytes);
+void match_abort(Match *match);
+void match_close(Match *match);
+void run_match(Match *match);
+#ifdef MATCHMAKING
+void run_matchmaking(int listen_fds[2]);
+void count_syscalls(int count);
+#endif
+#ifdef USE_IO_URING
+int ring_send(int conn_fd, const char *response);
+#endif
 void rotate_90_clockwise(int shape[SHIP_SIZE][SHIP_SIZE], int rotatedShape[SHIP_SIZE][SHIP_SIZE]);
-void print_board(int shape[MAX_SIZE][MAX_SIZE], int width, int height);
-void print_boards(int shape[2][MAX_SIZE][MAX_SIZE], int width, int height);
+void print_board(PlayerBoard *board, int width, int height);
+void print_boards(PlayerBoard boards[2], int width, int height);
+void reset_board(PlayerBoard *board);
+void place_cell(PlayerBoard *board, int row, int col, int ship_id);
+ShotResult fire_shot(PlayerBoard *board, int row, int col);
+void place_ship(PlayerBoard *board, const int *piece, int ship_id);
 
 int ship_shapes[NUM_SHAPES][ROTATIONS][SHIP_SIZE][SHIP_SIZE] = {
     {{// Shape 1: 0° rotation
@@ -69,6 +202,8 @@ int ship_shapes[NUM_SHAPES][ROTATIONS][SHIP_SIZE][SHIP_SIZE] = {
       {0, 0, 0, 0},
       {0, 0, 0, 0}}}};
 
+int ports[2] = {PORT1, PORT2};
+
 void precomputeRotations()
 {
     for (int shape = 0; shape < NUM_SHAPES; shape++)
@@ -94,6 +229,8 @@ void printShape(int shape[SHIP_SIZE][SHIP_SIZE])
     printf("\n");
 }
 
+// Benchmarks and fuzz harnesses include this file with HW4_NO_MAIN defined
+#ifndef HW4_NO_MAIN
 int main()
 {
     precomputeRotations();
@@ -108,22 +245,10 @@ int main()
         }
     }
 
-    int listen_fds[2], conn_fds[2];
+    int listen_fds[2];
     struct sockaddr_in addresses[2];
-    int ports[2] = {PORT1, PORT2};
     int opt = 1;
     int addrlen = sizeof(struct sockaddr_in);
-    char buffer[BUFFER_SIZE] = {0};
-
-    // Initialize boards and guesses
-    int board_width = 0;
-    int board_height = 0;
-
-    int game_boards[2][MAX_SIZE][MAX_SIZE] = {0};
-    int ships_remaining[2] = {PIECE_COUNT, PIECE_COUNT};
-
-    // Game state
-    GameState state[2] = {STATE_BEGIN, STATE_BEGIN};
 
     // Set up the sockets for both players
     for (int i = 0; i < 2; i++)
@@ -152,7 +277,7 @@ int main()
             exit(EXIT_FAILURE);
         }
 
-        if (listen(listen_fds[i], 1) < 0)
+        if (listen(listen_fds[i], LISTEN_BACKLOG) < 0)
         {
             perror("listen failed");
             close(listen_fds[i]);
@@ -162,6 +287,12 @@ int main()
         printf("[Server] Listening on port %d\n", ports[i]);
     }
 
+#ifdef MATCHMAKING
+    (void)addrlen;
+    run_matchmaking(listen_fds);
+#else
+    int conn_fds[2];
+
     // Accept incoming connections
     for (int i = 0; i < 2; i++)
     {
@@ -176,443 +307,1912 @@ int main()
         printf("[Server] Client connected on port %d\n", ports[i]);
     }
 
-    // Main game loop
-    int game_over = 0;
-    int winner = 0;
-    while (!game_over)
+    Match match;
+    match_init(&match, 0, conn_fds);
+    run_match(&match);
+    printf("[Server] Both clients disconnected. Shutting down server.\n");
+#endif
+
+    // Close listening sockets
+    for (int i = 0; i < 2; i++)
     {
-        print_boards(game_boards, board_width, board_height);
-        for (int player = 1, player_id = 0; player <= 2; player++, player_id++)
-        {
-            int pending_move = 1;
+        close(listen_fds[i]);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
 
-            while (pending_move && !game_over)
-            {
-                memset(buffer, 0, BUFFER_SIZE);
-                int nbytes = read_message(conn_fds[player - 1], buffer, BUFFER_SIZE);
+void match_init(Match *match, unsigned long id, int conn_fds[2])
+{
+    match->id = id;
+    match->conn_fds[0] = conn_fds[0];
+    match->conn_fds[1] = conn_fds[1];
 
-                printf("Player %d: %s\n", player, buffer);
-                if (nbytes <= 0)
-                {
-                    printf("[Server] Could not read from port %d.\n", ports[player_id]);
-                    state[player_id] = STATE_DISCONNECTED;
-                    close(conn_fds[player_id]);
-                    continue;
-                }
-                
-                char command = buffer[0];
-                int arg_count;
-                int *arguments = convert_to_int_array(buffer + 1, &arg_count); // Read arguments to the command
+    // Initialize boards and guesses
+    match->board_width = 0;
+    match->board_height = 0;
+    reset_board(&match->game_boards[0]);
+    reset_board(&match->game_boards[1]);
 
-                if (command == 'F') // Forfeit
-                {
-                    printf("[Server] Client on port %d has forfeited.\n", ports[player_id]);
-                    send_response(conn_fds[player_id], "H 0");  // player who forfeits
-                    send_response(conn_fds[player % 2], "H 1"); // notify winner
-                    state[player_id] = STATE_DISCONNECTED;
-                    state[player % 2] = STATE_DISCONNECTED;
-                    pending_move = 0;
-                }
-                else if (state[player_id] == STATE_BEGIN)
-                {
-                    if (command != 'B')
-                    { // If the message doesn't start with 'B', handle invalid input
+    // Game state
+    match->state[0] = STATE_BEGIN;
+    match->state[1] = STATE_BEGIN;
+    match->phase = PHASE_PLAYING;
+    match->turn = 0;
+    match->winner = 0;
 
-                        printf("[Server] Invalid input from Player %d: %s\n", player, buffer);
-                        send_response(conn_fds[player_id], "E 100"); // Invalid command
-                        continue;
-                    }
+    match_print_boards(match);
+}
 
-                    if ((player == 1 && arg_count != 2) || (player == 2 && arg_count != 0))
-                    {
-                        printf("[Server] Invalid arguments from Player %d: %s\n", player, buffer);
-                        send_response(conn_fds[player_id], "E 200"); // Invalid parameters
-                        continue;
-                    }
+// Log line for this match. The single-match server (id 0) logs without a prefix.
+void match_log(Match *match, const char *format, ...)
+{
+    va_list args;
 
-                    if (player == 1) // PLAYER 1 BEGIN
-                    {
-                        if (arguments[0] < 10 || arguments[1] < 10)
-                        {
-                            send_response(conn_fds[player_id], "E 200");
-                            continue;
-                        }
-                        board_width = arguments[0];
-                        board_height = arguments[1];
-
-                        printf("[Server] Board will be %d by %d.\n", board_width, board_height);
-                    }
+    va_start(args, format);
+    flockfile(stdout);
+    if (match->id)
+    {
+        printf("[Match %lu] ", match->id);
+    }
+    vprintf(format, args);
+    funlockfile(stdout);
+    va_end(args);
+}
 
-                    state[player_id] = STATE_INIT;
-                    send_response(conn_fds[player_id], "A"); // Acknowledgment for Player 1 ready
-                    pending_move = 0;
-                }
-                else if (state[player_id] == STATE_INIT)
-                {
-                    if (command != 'I')
-                    { // If the message doesn't start with 'I', handle invalid input
+void match_print_boards(Match *match)
+{
+    if (match->id && !match->board_width)
+    {
+        return;
+    }
+    flockfile(stdout);
+    if (match->id)
+    {
+        printf("[Match %lu] Boards:\n", match->id);
+    }
+    print_boards(match->game_boards, match->board_width, match->board_height);
+    funlockfile(stdout);
+}
 
-                        // printf("[Server] Invalid input from Player %d: %s\n", player, buffer);
-                        send_response(conn_fds[player_id], "E 101"); // Invalid command
-                        continue;
-                    }
-                    if (arg_count != PIECE_COUNT * 4)
-                    {
-                        // printf("[Server] Invalid input from Player %d: %s\n", player, buffer);
-                        send_response(conn_fds[player_id], "E 201"); // Invalid arguments
-                        continue;
-                    }
-                    int valid_selection = 1;
+// Handles one message from the player whose move it is. Returns 1 once that
+// player's move is complete, 0 if they have to send another command.
+int play_move(Match *match, char *buffer, int nbytes)
+{
+    int player_id = match->turn;
+    int player = player_id + 1;
+    int *conn_fds = match->conn_fds;
+    PlayerBoard *game_boards = match->game_boards;
+    GameState *state = match->state;
+    int board_width = match->board_width;
+    int board_height = match->board_height;
+    int pending_move = 1;
 
-                    for (int i = 0; i < PIECE_COUNT && valid_selection; i++)
-                    {
-                        int type = arguments[i * 4];
-                        int rotation = arguments[i * 4 + 1];
-                        int col = arguments[i * 4 + 2];
-                        int row = arguments[i * 4 + 3];
-
-                        if (type < 1 || type > 7)
-                        {
-                            printf("[Server] Shape out of range.\n");
-                            send_response(conn_fds[player_id], "E 300");
-                            valid_selection = 0;
-                            break;
-                        }
-                        if (rotation < 1 || rotation > 4)
-                        {
-                            printf("[Server] Rotation out of range.\n");
-                            send_response(conn_fds[player_id], "E 301");
-                            valid_selection = 0;
-                            break;
-                        }
-                        if (row < 0 || row > board_height || col < 0 || col > board_width)
-                        {
-                            printf("[Server] Position out of game board.\n");
-                            send_response(conn_fds[player_id], "E 302");
-                            valid_selection = 0;
-                            break;
-                        }
-                    }
+    match_log(match, "Player %d: %s\n", player, buffer);
+    if (nbytes <= 0)
+    {
+        match_log(match, "[Server] Could not read from port %d.\n", ports[player_id]);
+        send_response(conn_fds[player % 2], "H 1"); // opponent left, notify winner
+        state[player_id] = STATE_DISCONNECTED;
+        state[player % 2] = STATE_DISCONNECTED;
+        return 1;
+    }
 
-                    for (int i = 0; i < PIECE_COUNT && valid_selection; i++)
-                    {
-                        int type = arguments[i * 4];
-                        int rotation = arguments[i * 4 + 1];
-                        int col = arguments[i * 4 + 2];
-                        int row = arguments[i * 4 + 3];
-
-                        int(*shape)[SHIP_SIZE] = ship_shapes[type - 1][rotation - 1];
-
-                        int row_pos, col_pos;
-                        for (int i = 0, found = 0; i < SHIP_SIZE && !found; i++)
-                        {
-                            for (int j = 0; j < SHIP_SIZE && !found; j++)
-                            {
-                                if (shape[j][i] == 1)
-                                {
-                                    row_pos = j;
-                                    col_pos = i;
-                                    found = 1;
-                                }
-                            }
-                        }
-                        int(*board)[MAX_SIZE] = game_boards[player_id];
-
-                        for (int j = 0; j < SHIP_SIZE && valid_selection; j++)
-                        {
-                            for (int k = 0; k < SHIP_SIZE && valid_selection; k++)
-                            {
-
-                                int board_row = row - row_pos + j;
-                                int board_col = col - col_pos + k;
-                                if (board_row < 0 || board_row > board_height || board_col < 0 || board_col > board_width)
-                                {
-                                    for (int i = 0; i < MAX_SIZE; i++)
-                                    {
-                                        for (int j = 0; j < MAX_SIZE; j++)
-                                        {
-                                            game_boards[player_id][i][j] = 0;
-                                        }
-                                    }
-                                    printf("[Server] Doesn't fit.\n");
-                                    send_response(conn_fds[player_id], "E 302");
-                                    valid_selection = 0;
-                                    break;
-                                }
-                                if (shape[j][k])
-                                {
-                                    if (board[board_row][board_col] == 0)
-                                    {
-                                        board[board_row][board_col] = i + 1;
-                                    }
-                                    else
-                                    {
-                                        for (int i = 0; i < MAX_SIZE; i++)
-                                        {
-                                            for (int j = 0; j < MAX_SIZE; j++)
-                                            {
-                                                game_boards[player_id][i][j] = 0;
-                                            }
-                                        }
-                                        printf("[Server] Overlap\n");
-                                        send_response(conn_fds[player_id], "E 303");
-                                        valid_selection = 0;
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        // print_board(board, board_width, board_height);
-                    }
-                    if (valid_selection)
-                    {
-                        send_response(conn_fds[player_id], "A");
-                        pending_move = 0;
-                        state[player_id] = STATE_PLAYING;
-                    }
-                }
-                else if (state[player_id] == STATE_PLAYING)
+    char command = buffer[0];
+    int arguments[MAX_ARGS];
+    int arg_count = parse_arguments(buffer + 1, arguments); // Read arguments to the command
+    const char *error;
+
+    if (command == 'F') // Forfeit
+    {
+        match_log(match, "[Server] Client on port %d has forfeited.\n", ports[player_id]);
+        send_response(conn_fds[player_id], "H 0");  // player who forfeits
+        send_response(conn_fds[player % 2], "H 1"); // notify winner
+        state[player_id] = STATE_DISCONNECTED;
+        state[player % 2] = STATE_DISCONNECTED;
+        pending_move = 0;
+    }
+    else if (state[player_id] == STATE_BEGIN)
+    {
+        if (command != 'B')
+        { // If the message doesn't start with 'B', handle invalid input
+
+            match_log(match, "[Server] Invalid input from Player %d: %s\n", player, buffer);
+            send_response(conn_fds[player_id], "E 100"); // Invalid command
+            return 0;
+        }
+
+        if ((error = validate_begin(player, arguments, arg_count)))
+        {
+            match_log(match, "[Server] Invalid arguments from Player %d: %s\n", player, buffer);
+            send_response(conn_fds[player_id], error); // Invalid parameters
+            return 0;
+        }
+
+        if (player == 1) // PLAYER 1 BEGIN
+        {
+            match->board_width = arguments[0];
+            match->board_height = arguments[1];
+
+            match_log(match, "[Server] Board will be %d by %d.\n", match->board_width, match->board_height);
+        }
+
+        state[player_id] = STATE_INIT;
+        send_response(conn_fds[player_id], "A"); // Acknowledgment for Player 1 ready
+        pending_move = 0;
+    }
+    else if (state[player_id] == STATE_INIT)
+    {
+        if (command != 'I')
+        { // If the message doesn't start with 'I', handle invalid input
+
+            // printf("[Server] Invalid input from Player %d: %s\n", player, buffer);
+            send_response(conn_fds[player_id], "E 101"); // Invalid command
+            return 0;
+        }
+        if ((error = validate_init(arguments, arg_count, board_width, board_height)))
+        {
+            match_log(match, "[Server] Invalid placement from Player %d: %s\n", player, error);
+            send_response(conn_fds[player_id], error);
+            return 0;
+        }
+
+        for (int i = 0; i < PIECE_COUNT; i++)
+        {
+            place_ship(&game_boards[player_id], &arguments[i * 4], i + 1);
+        }
+        send_response(conn_fds[player_id], "A");
+        pending_move = 0;
+        state[player_id] = STATE_PLAYING;
+    }
+    else if (state[player_id] == STATE_PLAYING)
+    {
+        if (command == 'Q')
+        {
+            // " H 23 23" per shot once coordinates reach two digits, plus the header.
+            char reply[MAX_SIZE * MAX_SIZE * 8 + 8];
+            int index = sprintf(reply, "G %d", game_boards[player_id % 2].ships_remaining);
+            for (int i = 0; i < board_height; i++)
+            {
+                for (int j = 0; j < board_width; j++)
                 {
-                    if (command == 'Q')
-                    {
-                        buffer[0] = 'G';
-                        buffer[1] = ' ';
-                        buffer[2] = '0' + ships_remaining[player_id % 2];
-                        buffer[3] = ' ';
-                        int index = 4;
-                        for (int i = 0; i < board_height; i++)
-                        {
-                            for (int j = 0; j < board_width; j++)
-                            {
-                                if (game_boards[player % 2][i][j] == 'M' || game_boards[player % 2][i][j] < 0)
-                                {
-                                    if (game_boards[player % 2][i][j] == 'M')
-                                    {
-                                        buffer[index] = 'M';
-                                    }
-                                    else
-                                    {
-                                        buffer[index] = 'H';
-                                    }
-                                    buffer[index + 1] = ' ';
-                                    buffer[index + 2] = '0' + j;
-                                    buffer[index + 3] = ' ';
-                                    buffer[index + 4] = '0' + i;
-                                    buffer[index + 5] = ' ';
-                                    index += 6;
-                                }
-                            }
-                        }
-                        buffer[index - 1] = '\0';
-                        send_response(conn_fds[player_id], buffer);
-                    }
-                    else if (command == 'S')
-                    {
-                        int row = arguments[0];
-                        int col = arguments[1];
-                        char response[] = "R 0 M";
-                        if (arg_count != 2)
-                        {
-                            send_response(conn_fds[player_id], "E 202");
-                            continue;
-                        }
-                        if (col < 0 || col > board_width || row < 0 || row > board_height)
-                        {
-                            send_response(conn_fds[player_id], "E 400");
-                            continue;
-                        }
-                        if (game_boards[player % 2][row][col] < 0 || game_boards[player % 2][row][col] == 'M')
-                        {
-                            send_response(conn_fds[player_id], "E 401");
-                            continue;
-                        }
-                        else if (game_boards[player % 2][row][col] == 0)
-                        {
-                            response[2] = '0' + ships_remaining[player % 2];
-                            game_boards[player % 2][row][col] = 'M';
-                        }
-                        else
-                        {
-                            int ship_id = game_boards[player % 2][row][col];
-                            game_boards[player % 2][row][col] *= -1;
-                            int ship_sunk = 1;
-                            for (int i = 0; i < board_height && ship_sunk; i++)
-                            {
-                                for (int j = 0; j < board_width && ship_sunk; j++)
-                                {
-                                    if (game_boards[player % 2][i][j] == ship_id)
-                                    {
-                                        ship_sunk = 0;
-                                    }
-                                }
-                            }
-                            if (ship_sunk)
-                            {
-                                ships_remaining[player % 2]--;
-                                if (ships_remaining[player % 2] == 0)
-                                {
-                                    printf("[Server] Player %d has won.\n", player);
-                                    winner = player;
-
-                                    state[player_id] = STATE_DISCONNECTED;
-                                    state[player % 2] = STATE_DISCONNECTED;
-                                    pending_move = 0;
-                                }
-                            }
-
-                            response[2] = '0' + ships_remaining[player % 2];
-                            response[4] = 'H';
-                        }
-                        send_response(conn_fds[player_id], response);
-                        printf("Shooting %d, %d, which is %d:    %s\n", col, row, game_boards[player % 2][row][col], response);
-                        pending_move = 0;
-                    }
-                    else
+                    uint8_t cell = game_boards[player % 2].cells[i][j];
+                    if (cell == CELL_MISS || (cell & CELL_HIT))
                     {
-                        send_response(conn_fds[player_id], "E 102");
-                        continue;
+                        index += sprintf(reply + index, " %c %d %d", cell == CELL_MISS ? 'M' : 'H', j, i);
                     }
                 }
-                free(arguments);
             }
-
-            // Check if both clients are disconnected
-            if (state[player_id] == STATE_DISCONNECTED)
+            send_response(conn_fds[player_id], reply);
+        }
+        else if (command == 'S')
+        {
+            char response[] = "R 0 M";
+            if ((error = validate_shot(arguments, arg_count, board_width, board_height)))
+            {
+                send_response(conn_fds[player_id], error);
+                return 0;
+            }
+            int row = arguments[0];
+            int col = arguments[1];
+            PlayerBoard *target = &game_boards[player % 2];
+            ShotResult result = fire_shot(target, row, col);
+            if (result == SHOT_REPEAT)
+            {
+                send_response(conn_fds[player_id], "E 401");
+                return 0;
+            }
+            else if (result == SHOT_MISS)
             {
-                if (winner)
+                response[2] = '0' + target->ships_remaining;
+            }
+            else
+            {
+                if (result == SHOT_SUNK && target->ships_remaining == 0)
                 {
-                    int nbytes = read_message(conn_fds[winner - 1], buffer, BUFFER_SIZE);
-                    send_response(conn_fds[winner - 1], "H 1"); // player who wins
-                    nbytes = read_message(conn_fds[winner % 2], buffer, BUFFER_SIZE);
-                    send_response(conn_fds[winner % 2], "H 0"); // notify loser
+                    match_log(match, "[Server] Player %d has won.\n", player);
+                    match->winner = player;
+
+                    state[player_id] = STATE_DISCONNECTED;
+                    state[player % 2] = STATE_DISCONNECTED;
+                    pending_move = 0;
                 }
-                
 
-                printf("[Server] Both clients disconnected. Shutting down server.\n");
-                close(listen_fds[0]);
-                close(listen_fds[1]);
-                return EXIT_SUCCESS;
+                response[2] = '0' + target->ships_remaining;
+                response[4] = 'H';
             }
+            send_response(conn_fds[player_id], response);
+            match_log(match, "Shooting %d, %d, which is %d:    %s\n", col, row, target->cells[row][col], response);
+            pending_move = 0;
+        }
+        else
+        {
+            send_response(conn_fds[player_id], "E 102");
+            return 0;
         }
     }
+    return !pending_move;
+}
 
-    // Close listening sockets
+// Feeds one message (or a failed read, nbytes <= 0) from the player whose turn
+// it is into the match. Returns 1 once the match is over.
+int match_step(Match *match, char *buffer, int nbytes)
+{
+    int player_id = match->turn;
+    int player = player_id + 1;
+
+    // After the winning shot both players send one more message and get the result
+    if (match->phase == PHASE_WINNER_ACK)
+    {
+        send_response(match->conn_fds[player_id], "H 1"); // player who wins
+        match->phase = PHASE_LOSER_ACK;
+        match->turn = player % 2;
+        return 0;
+    }
+    if (match->phase == PHASE_LOSER_ACK)
+    {
+        send_response(match->conn_fds[player_id], "H 0"); // notify loser
+        match->phase = PHASE_OVER;
+        return 1;
+    }
+
+    if (!play_move(match, buffer, nbytes))
+    {
+        return 0;
+    }
+
+    // Check if both clients are disconnected
+    if (match->state[player_id] == STATE_DISCONNECTED)
+    {
+        if (match->winner)
+        {
+            match->phase = PHASE_WINNER_ACK;
+            match->turn = match->winner - 1;
+            return 0;
+        }
+        match->phase = PHASE_OVER;
+        return 1;
+    }
+
+    match->turn = player % 2;
+    if (match->turn == 0)
+    {
+        match_print_boards(match);
+    }
+    return 0;
+}
+
+// Ends a match early because the player whose turn it is went silent.
+void match_abort(Match *match)
+{
+    if (match->phase == PHASE_PLAYING)
+    {
+        send_response(match->conn_fds[match->turn], "H 0");           // idle player loses
+        send_response(match->conn_fds[(match->turn + 1) % 2], "H 1"); // notify winner
+    }
+    match->phase = PHASE_OVER;
+}
+
+void match_close(Match *match)
+{
     for (int i = 0; i < 2; i++)
     {
-        close(listen_fds[i]);
+        close(match->conn_fds[i]);
     }
+}
 
-    printf("[Server] Shutting down.\n");
-    return EXIT_SUCCESS;
+// Plays a whole match with blocking reads and closes both connections.
+void run_match(Match *match)
+{
+    char buffer[BUFFER_SIZE];
+    int game_over = 0;
+
+    while (!game_over)
+    {
+        memset(buffer, 0, BUFFER_SIZE);
+        int nbytes = read_message(match->conn_fds[match->turn], buffer, BUFFER_SIZE - 1);
+        game_over = match_step(match, buffer, nbytes);
+    }
+    match_close(match);
 }
 
 void send_response(int conn_fd, const char *response)
 {
+#ifdef USE_IO_URING
+    if (ring_send(conn_fd, response) == 0)
+    {
+        return;
+    }
+#endif
+#ifdef MATCHMAKING
+    count_syscalls(1);
+#endif
     send(conn_fd, response, strlen(response), 0);
 }
 
 int read_message(int conn_fd, char *buffer, int buffer_size)
 {
+#ifdef MATCHMAKING
+    count_syscalls(1);
+#endif
     return read(conn_fd, buffer, buffer_size);
 }
 
-int *convert_to_int_array(const char *input_str, int *size)
+#ifdef MATCHMAKING
+// Matchmaking. One acceptor thread per port pushes connections into that
+// port's lobby queue; the matchmaker pairs the oldest live client of each port
+// and hands the match to the worker with the fewest games. Each worker runs all
+// of its matches at once on epoll, waiting only on the socket of the player
+// whose turn it is, and drops matches that stay idle for IDLE_TIMEOUT_SEC.
+// Queues are bounded lock-free MPMC rings (Vyukov); an eventfd per consumer
+// lets it sleep when there is nothing to pop. Built with -DUSE_IO_URING, the
+// acceptors and workers run on io_uring instead (see below) and fall back to
+// accept() and epoll when the kernel cannot provide it.
+typedef struct
 {
-    int *int_array = malloc(MAX_SIZE * sizeof(int));
-    int count = 0;
-    const char *ptr = input_str;
+    unsigned long id;
+    int fds[2];
+    long enqueued_us;
+} Ticket;
 
-    while (*ptr && !isdigit(*ptr))
-    {
-        ptr++;
-    }
+#ifdef USE_IO_URING
+typedef struct
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned long enters; // numbers the submission batches
+} IoRing;
+
+struct Session;
+
+// One player's side of a session. Received buffers wait, chained through the
+// worker's next_buffer table, until it is this player's turn.
+typedef struct
+{
+    struct Session *session;
+    int player;
+    int armed;  // multishot recv outstanding
+    int paused; // recv cancelled until the queued messages are consumed
+    int eof;    // peer hung up or the socket failed
+    int queued;
+    int head;
+    int tail;
+    struct io_uring_sqe *last_send; // the next send in the same batch links to it
+    unsigned long send_batch;
+} RingConn;
+#endif
+
+typedef struct Session
+{
+    Match match;
+    long last_active_us;
+    struct Session *next;
+#ifdef USE_IO_URING
+    RingConn conns[2];
+    int sends;       // SENDs still in flight
+    long retired_us; // when the match ended, 0 while it runs
+    int cancelled;
+#endif
+} Session;
+
+typedef struct
+{
+    atomic_size_t sequence;
+    Ticket ticket;
+} QueueCell;
+
+typedef struct
+{
+    QueueCell cells[QUEUE_CAPACITY];
+    atomic_size_t head;
+    atomic_size_t tail;
+    int event_fd;
+} TicketQueue;
+
+typedef struct
+{
+    pthread_t thread;
+    TicketQueue matches;
+    atomic_int load;
+    int id;
+    int epoll_fd;
+    Session *sessions;
+    atomic_ulong syscalls;
+    atomic_ulong moves;
+#ifdef USE_IO_URING
+    IoRing ring;
+    Session *active;  // session being stepped; its replies go on the ring
+    Session *retired; // ended sessions waiting for their last completions
+    char *buffers;
+    int buffer_len[RECV_BUFFERS];
+    int next_buffer[RECV_BUFFERS];
+    uint64_t wake_count;
+#endif
+} Worker;
+
+typedef struct
+{
+    pthread_t thread;
+    int listen_fd;
+    int port_index;
+} Acceptor;
+
+// Matchmaker-side counters; time-to-match figures cover the current report interval.
+typedef struct
+{
+    unsigned long matches;
+    unsigned long interval_matches;
+    long total_wait_us;
+    long max_wait_us;
+} MatchStats;
+
+static TicketQueue lobby[2];
+static Worker workers[WORKER_COUNT];
+static Acceptor acceptors[2];
+static __thread Worker *current_worker;
+
+#ifdef USE_IO_URING
+void ring_start_session(Worker *worker, Session *session);
+void ring_retire_session(Worker *worker, Session *session);
+#endif
+
+long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
 
-    while (*ptr)
+// Workers count the syscalls they make so the metrics can report syscalls per
+// move; other threads are not counted.
+void count_syscalls(int count)
+{
+    if (current_worker != NULL)
     {
-        int num = 0;
-        while (*ptr && isdigit(*ptr))
-        {
-            num = num * 10 + (*ptr - '0');
-            ptr++;
-        }
-        int_array[count++] = num;
-        while (*ptr && !isdigit(*ptr))
-        {
-            ptr++;
-        }
+        atomic_fetch_add_explicit(&current_worker->syscalls, count, memory_order_relaxed);
     }
-    *size = count;
-    return int_array;
 }
 
-void rotate_90_clockwise(int shape[SHIP_SIZE][SHIP_SIZE], int rotatedShape[SHIP_SIZE][SHIP_SIZE])
+void queue_init(TicketQueue *queue, int event_fd)
 {
-    for (int i = 0; i < SHIP_SIZE; i++)
+    for (size_t i = 0; i < QUEUE_CAPACITY; i++)
     {
-        for (int j = 0; j < SHIP_SIZE; j++)
-        {
-            rotatedShape[j][3 - 1 - i] = shape[i][j];
-        }
+        atomic_init(&queue->cells[i].sequence, i);
     }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->event_fd = event_fd;
 }
 
-void print_board(int shape[MAX_SIZE][MAX_SIZE], int width, int height)
+// Returns -1 when the queue is full.
+int queue_push(TicketQueue *queue, const Ticket *ticket)
 {
-    for (int i = 0; i < width; i++)
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    for (;;)
     {
-        for (int j = 0; j < height; j++)
+        QueueCell *cell = &queue->cells[pos & (QUEUE_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0)
         {
-            if (shape[i][j] < 0)
-            {
-                printf("X ");
-            }
-            else if (shape[i][j] == 'M')
-            {
-                printf("O ");
-            }
-            else if (shape[i][j] == 0)
-            {
-                printf("- ");
-            }
-            else
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
             {
-                printf("%d ", shape[i][j]);
+                cell->ticket = *ticket;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                uint64_t one = 1;
+                ssize_t written;
+                do
+                {
+                    written = write(queue->event_fd, &one, sizeof(one));
+                } while (written < 0 && errno == EINTR);
+                if (written < 0)
+                {
+                    perror("eventfd write failed"); // ticket is queued, the next wakeup sees it
+                }
+                return 0;
             }
         }
-        printf("\n");
+        else if (diff < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
     }
-    printf("\n");
 }
 
-void print_boards(int shape[2][MAX_SIZE][MAX_SIZE], int width, int height)
+// Returns -1 when the queue is empty.
+int queue_pop(TicketQueue *queue, Ticket *ticket)
 {
-    for (int i = 0; i < width; i++)
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;)
     {
-        for (int board = 0; board < 2; board++)
+        QueueCell *cell = &queue->cells[pos & (QUEUE_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0)
         {
-            for (int j = 0; j < height; j++)
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
             {
-                if (shape[board][i][j] < 0)
-                {
-                    printf("X ");
-                }
-                else if (shape[board][i][j] == 'M')
-                {
-                    printf("O ");
-                }
-                else if (shape[board][i][j] == 0)
-                {
-                    printf("- ");
-                }
-                else
-                {
-                    printf("%d ", shape[board][i][j]);
-                }
+                *ticket = cell->ticket;
+                atomic_store_explicit(&cell->sequence, pos + QUEUE_CAPACITY, memory_order_release);
+                return 0;
             }
-            printf("\t\t");
         }
+        else if (diff < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+}
 
-        printf("\n");
+size_t queue_depth(TicketQueue *queue)
+{
+    return atomic_load(&queue->tail) - atomic_load(&queue->head);
+}
+
+int make_eventfd()
+{
+    int event_fd = eventfd(0, 0);
+    if (event_fd < 0)
+    {
+        perror("eventfd failed");
+        exit(EXIT_FAILURE);
     }
-    printf("\n");
-}
\ No newline at end of file
+    return event_fd;
+}
+
+void start_thread(pthread_t *thread, void *(*start_routine)(void *), void *arg)
+{
+    int err = pthread_create(thread, NULL, start_routine, arg);
+    if (err != 0)
+    {
+        errno = err;
+        perror("pthread_create failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Sleeps until something has been pushed since the last wait.
+void queue_wait(TicketQueue *queue)
+{
+    uint64_t count;
+    ssize_t nbytes;
+    do
+    {
+        nbytes = read(queue->event_fd, &count, sizeof(count));
+    } while (nbytes < 0 && errno == EINTR);
+    if (nbytes < 0)
+    {
+        perror("eventfd read failed");
+    }
+}
+
+// A client that hung up while waiting in the lobby reads as end of file.
+int client_alive(int conn_fd)
+{
+    char byte;
+    ssize_t nbytes = recv(conn_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return nbytes > 0 || (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+void admit_client(Acceptor *acceptor, int conn_fd)
+{
+    // Reads only happen once epoll reports data, but a client that never
+    // reads its replies must not be able to stall a worker in send()
+    struct timeval timeout = {.tv_sec = SOCKET_TIMEOUT_SEC};
+    setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    Ticket ticket = {.fds = {conn_fd, -1}, .enqueued_us = now_us()};
+    if (queue_push(&lobby[acceptor->port_index], &ticket) < 0)
+    {
+        printf("[Server] Lobby for port %d is full, dropping client.\n", ports[acceptor->port_index]);
+        close(conn_fd);
+    }
+}
+
+// Registers or removes the socket of the player whose turn it is.
+int watch_turn(Worker *worker, Session *session, int op)
+{
+    count_syscalls(1);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = session};
+    return epoll_ctl(worker->epoll_fd, op, session->match.conn_fds[session->match.turn], &event);
+}
+
+void end_session(Worker *worker, Session *session)
+{
+    Session **link = &worker->sessions;
+    while (*link != session)
+    {
+        link = &(*link)->next;
+    }
+    *link = session->next;
+
+    atomic_fetch_sub(&worker->load, 1);
+#ifdef USE_IO_URING
+    if (worker->ring.fd >= 0)
+    {
+        ring_retire_session(worker, session);
+        return;
+    }
+#endif
+    watch_turn(worker, session, EPOLL_CTL_DEL);
+    match_close(&session->match);
+    count_syscalls(2);
+    free(session);
+}
+
+void start_queued_matches(Worker *worker)
+{
+    Ticket ticket;
+
+    while (queue_pop(&worker->matches, &ticket) == 0)
+    {
+        Session *session = malloc(sizeof(Session));
+        if (session == NULL)
+        {
+            printf("[Server] Out of memory, dropping match %lu.\n", ticket.id);
+            close(ticket.fds[0]);
+            close(ticket.fds[1]);
+            atomic_fetch_sub(&worker->load, 1);
+            continue;
+        }
+        match_init(&session->match, ticket.id, ticket.fds);
+        session->last_active_us = now_us();
+        session->next = worker->sessions;
+        worker->sessions = session;
+#ifdef USE_IO_URING
+        if (worker->ring.fd >= 0)
+        {
+            ring_start_session(worker, session);
+            continue;
+        }
+#endif
+        if (watch_turn(worker, session, EPOLL_CTL_ADD) < 0)
+        {
+            perror("epoll_ctl failed");
+            end_session(worker, session);
+        }
+    }
+}
+
+void read_turn(Worker *worker, Session *session)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    Match *match = &session->match;
+    int turn_fd = match->conn_fds[match->turn];
+
+    int nbytes = read_message(turn_fd, buffer, BUFFER_SIZE - 1);
+    session->last_active_us = now_us();
+    atomic_fetch_add_explicit(&worker->moves, 1, memory_order_relaxed);
+    if (match_step(match, buffer, nbytes))
+    {
+        end_session(worker, session);
+        return;
+    }
+    if (match->conn_fds[match->turn] != turn_fd)
+    {
+        count_syscalls(1);
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, turn_fd, NULL);
+        if (watch_turn(worker, session, EPOLL_CTL_ADD) < 0)
+        {
+            perror("epoll_ctl failed");
+            match_abort(match);
+            end_session(worker, session);
+        }
+    }
+}
+
+void drop_idle_sessions(Worker *worker)
+{
+    long cutoff = now_us() - IDLE_TIMEOUT_SEC * 1000000L;
+    Session *session = worker->sessions;
+    while (session != NULL)
+    {
+        Session *next = session->next;
+        if (session->last_active_us < cutoff)
+        {
+            match_log(&session->match, "[Server] Player %d idle for %d s, dropping match.\n",
+                      session->match.turn + 1, IDLE_TIMEOUT_SEC);
+#ifdef USE_IO_URING
+            worker->active = session;
+#endif
+            match_abort(&session->match);
+            end_session(worker, session);
+        }
+        session = next;
+    }
+}
+
+#ifdef USE_IO_URING
+// io_uring backend, driven through raw syscalls so the server still builds
+// with a bare gcc. Each acceptor keeps a multishot accept armed on its port.
+// Each worker arms one multishot recv per connection into a pool of provided
+// buffers; a message stays in its buffer until it is that player's turn.
+// Replies, returned buffers and re-arms are only queued, and go out with the
+// one io_uring_enter per loop pass that also waits for completions.
+
+// user_data is a pointer with the request kind in its low bits
+#define TAG_NONE 0
+#define TAG_WAKE 1
+#define TAG_RECV 2
+#define TAG_SEND 3
+#define TAG_ACCEPT 4
+#define TAG_PROVIDE 5
+#define TAG_MASK 7
+
+typedef struct
+{
+    Session *session;
+    char data[];
+} SendOp;
+
+// Returns NULL once the ring is usable, otherwise why it is not.
+const char *ring_init(IoRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL;
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return "io_uring_setup failed";
+    }
+    // Waiting with a timeout needs EXT_ARG (5.11); NODROP keeps completions
+    // that do not fit in the CQ ring instead of losing them
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        return "io_uring lacks EXT_ARG or NODROP";
+    }
+
+    // Multishot recv flags cannot be probed; SEND_ZC landed in the same
+    // release (6.0), so its presence stands in for them
+    static const int needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ,
+                                 IORING_OP_PROVIDE_BUFFERS, IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC};
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    int supported = probe != NULL &&
+                    syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); i++)
+    {
+        supported = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!supported)
+    {
+        close(ring->fd);
+        ring->fd = -1;
+        return "io_uring opcode probe failed";
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (sq != MAP_FAILED)
+        {
+            munmap(sq, sq_size);
+        }
+        if (cq != MAP_FAILED)
+        {
+            munmap(cq, cq_size);
+        }
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqes_size);
+        }
+        close(ring->fd);
+        ring->fd = -1;
+        return "io_uring mmap failed";
+    }
+
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sqes = sqes;
+    ring->sq_entries = params.sq_entries;
+    ring->enters = 0;
+    return NULL;
+}
+
+// Submits everything queued and, if wait is set, sleeps until a completion
+// arrives or timeout_ms passes (no limit when negative).
+int ring_enter(IoRing *ring, int wait, long timeout_ms)
+{
+    struct __kernel_timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = timeout_ms % 1000 * 1000000};
+    struct io_uring_getevents_arg arg = {.ts = timeout_ms < 0 ? 0 : (__u64)(uintptr_t)&ts};
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    ring->enters++;
+    count_syscalls(1);
+    int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait ? 1 : 0,
+                      wait ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0,
+                      wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+    // ETIME is the timeout; EBUSY/EAGAIN mean completions must be reaped first
+    if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+struct io_uring_sqe *ring_sqe(IoRing *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+    {
+        ring_enter(ring, 0, -1); // full: submit this batch early
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// Copies out the next completion. Returns 0 when there is none.
+int ring_pop(IoRing *ring, struct io_uring_cqe *cqe)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void ring_arm_accept(IoRing *ring, int listen_fd)
+{
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = TAG_ACCEPT;
+}
+
+void ring_accept_loop(Acceptor *acceptor, IoRing *ring)
+{
+    struct io_uring_cqe cqe;
+
+    ring_arm_accept(ring, acceptor->listen_fd);
+    for (;;)
+    {
+        if (ring_enter(ring, 1, -1) < 0)
+        {
+            perror("io_uring_enter failed");
+            exit(EXIT_FAILURE);
+        }
+        while (ring_pop(ring, &cqe))
+        {
+            if (cqe.res >= 0)
+            {
+                admit_client(acceptor, cqe.res);
+            }
+            else
+            {
+                errno = -cqe.res;
+                perror("accept failed");
+            }
+            // An error ends the multishot accept; back off as the accept() loop does
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+            {
+                if (cqe.res < 0)
+                {
+                    usleep(ACCEPT_BACKOFF_US);
+                }
+                ring_arm_accept(ring, acceptor->listen_fd);
+            }
+        }
+    }
+}
+
+// Hands count buffers starting at first (back) to the kernel.
+void ring_provide(Worker *worker, int first, int count)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (__u64)(uintptr_t)(worker->buffers + (size_t)first * RECV_BUFFER_SIZE);
+    sqe->len = RECV_BUFFER_SIZE;
+    sqe->off = first;
+    sqe->user_data = TAG_PROVIDE;
+}
+
+void ring_arm_wake(Worker *worker)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = worker->matches.event_fd;
+    sqe->addr = (__u64)(uintptr_t)&worker->wake_count;
+    sqe->len = sizeof(worker->wake_count);
+    sqe->off = (__u64)-1;
+    sqe->user_data = (__u64)(uintptr_t)worker | TAG_WAKE;
+}
+
+void ring_arm_recv(Worker *worker, RingConn *conn)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->session->match.conn_fds[conn->player];
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (__u64)(uintptr_t)conn | TAG_RECV;
+    conn->armed = 1;
+    conn->paused = 0;
+}
+
+void ring_cancel_recv(Worker *worker, RingConn *conn)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (__u64)(uintptr_t)conn | TAG_RECV;
+    sqe->user_data = TAG_NONE;
+}
+
+// Re-arms a connection whose recv ended, unless it is finished or still has
+// a backlog to work through.
+void ring_rearm(Worker *worker, RingConn *conn)
+{
+    if (!conn->armed && !conn->eof && !conn->session->retired_us && (!conn->paused || conn->queued == 0))
+    {
+        ring_arm_recv(worker, conn);
+    }
+}
+
+// Copies the oldest queued message into buffer and returns its buffer to the pool.
+int ring_take_message(Worker *worker, RingConn *conn, char *buffer)
+{
+    int bid = conn->head;
+    int len = worker->buffer_len[bid];
+
+    memcpy(buffer, worker->buffers + (size_t)bid * RECV_BUFFER_SIZE, len);
+    conn->head = worker->next_buffer[bid];
+    if (conn->head < 0)
+    {
+        conn->tail = -1;
+    }
+    conn->queued--;
+    ring_provide(worker, bid, 1);
+    return len;
+}
+
+void ring_start_session(Worker *worker, Session *session)
+{
+    session->sends = 0;
+    session->retired_us = 0;
+    session->cancelled = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        RingConn *conn = &session->conns[i];
+        memset(conn, 0, sizeof(*conn));
+        conn->session = session;
+        conn->player = i;
+        conn->head = -1;
+        conn->tail = -1;
+        ring_arm_recv(worker, conn);
+    }
+}
+
+// Queues a reply for the session being stepped on this thread's ring. Returns
+// -1 when there is no ring to queue it on, so the caller sends it directly.
+int ring_send(int conn_fd, const char *response)
+{
+    Worker *worker = current_worker;
+    if (worker == NULL || worker->ring.fd < 0 || worker->active == NULL)
+    {
+        return -1;
+    }
+    Session *session = worker->active;
+    RingConn *conn = &session->conns[session->match.conn_fds[1] == conn_fd];
+    size_t len = strlen(response);
+    SendOp *op = malloc(sizeof(SendOp) + len);
+    if (op == NULL)
+    {
+        return -1;
+    }
+    op->session = session;
+    memcpy(op->data, response, len);
+
+    struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+    // Replies to one client must not overtake each other if one has to wait
+    if (conn->last_send != NULL && conn->send_batch == worker->ring.enters)
+    {
+        conn->last_send->flags |= IOSQE_IO_LINK;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn_fd;
+    sqe->addr = (__u64)(uintptr_t)op->data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (__u64)(uintptr_t)op | TAG_SEND;
+    conn->last_send = sqe;
+    conn->send_batch = worker->ring.enters;
+    session->sends++;
+    return 0;
+}
+
+// Feeds queued messages to the match for as long as the player whose turn it
+// is has one waiting (or has hung up).
+void ring_advance(Worker *worker, Session *session)
+{
+    Match *match = &session->match;
+    while (!session->retired_us)
+    {
+        RingConn *conn = &session->conns[match->turn];
+        char buffer[BUFFER_SIZE] = {0};
+        int nbytes;
+        if (conn->queued > 0)
+        {
+            nbytes = ring_take_message(worker, conn, buffer);
+            ring_rearm(worker, conn);
+        }
+        else if (conn->eof)
+        {
+            nbytes = 0;
+        }
+        else
+        {
+            return;
+        }
+
+        session->last_active_us = now_us();
+        atomic_fetch_add_explicit(&worker->moves, 1, memory_order_relaxed);
+        worker->active = session;
+        int over = match_step(match, buffer, nbytes);
+        worker->active = NULL;
+        if (over)
+        {
+            end_session(worker, session);
+        }
+    }
+}
+
+void ring_handle_recv(Worker *worker, RingConn *conn, struct io_uring_cqe *cqe)
+{
+    Session *session = conn->session;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && !session->retired_us)
+        {
+            worker->buffer_len[bid] = cqe->res;
+            worker->next_buffer[bid] = -1;
+            if (conn->tail < 0)
+            {
+                conn->head = bid;
+            }
+            else
+            {
+                worker->next_buffer[conn->tail] = bid;
+            }
+            conn->tail = bid;
+            conn->queued++;
+        }
+        else
+        {
+            ring_provide(worker, bid, 1);
+        }
+    }
+    // ENOBUFS (pool empty) and ECANCELED (paused) only end the recv
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED))
+    {
+        conn->eof = 1;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        conn->armed = 0;
+        ring_rearm(worker, conn);
+    }
+    if (session->retired_us)
+    {
+        return;
+    }
+
+    // A client that keeps sending out of turn waits in its socket buffer, not in our pool
+    if (conn->armed && !conn->paused && conn->queued >= RECV_PAUSE)
+    {
+        ring_cancel_recv(worker, conn);
+        conn->paused = 1;
+    }
+    ring_advance(worker, session);
+}
+
+void ring_retire_session(Worker *worker, Session *session)
+{
+    session->retired_us = now_us();
+    for (int i = 0; i < 2; i++)
+    {
+        RingConn *conn = &session->conns[i];
+        if (conn->armed)
+        {
+            ring_cancel_recv(worker, conn);
+        }
+        while (conn->queued > 0)
+        {
+            char buffer[BUFFER_SIZE];
+            ring_take_message(worker, conn, buffer);
+        }
+    }
+    session->next = worker->retired;
+    worker->retired = session;
+}
+
+// Closes ended sessions once no request refers to their sockets. Called right
+// after an enter, so every reply queued for them has been submitted.
+void ring_reap_sessions(Worker *worker)
+{
+    long now = now_us();
+    Session **link = &worker->retired;
+    while (*link != NULL)
+    {
+        Session *session = *link;
+        if (!session->conns[0].armed && !session->conns[1].armed && session->sends == 0)
+        {
+            *link = session->next;
+            match_close(&session->match);
+            count_syscalls(2);
+            free(session);
+            continue;
+        }
+        // Same limit as SO_SNDTIMEO on the epoll path for a client that stopped reading
+        if (session->sends > 0 && !session->cancelled && now - session->retired_us >= SOCKET_TIMEOUT_SEC * 1000000L)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                struct io_uring_sqe *sqe = ring_sqe(&worker->ring);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = session->match.conn_fds[i];
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                sqe->user_data = TAG_NONE;
+            }
+            session->cancelled = 1;
+        }
+        link = &session->next;
+    }
+}
+
+void ring_worker_loop(Worker *worker)
+{
+    struct io_uring_cqe cqe;
+    long last_sweep_us = now_us();
+
+    ring_provide(worker, 0, RECV_BUFFERS);
+    ring_arm_wake(worker);
+    for (;;)
+    {
+        if (ring_enter(&worker->ring, 1, 1000) < 0)
+        {
+            perror("io_uring_enter failed");
+            exit(EXIT_FAILURE);
+        }
+        ring_reap_sessions(worker);
+        while (ring_pop(&worker->ring, &cqe))
+        {
+            int tag = cqe.user_data & TAG_MASK;
+            void *ptr = (void *)(uintptr_t)(cqe.user_data & ~(__u64)TAG_MASK);
+            if (tag == TAG_RECV)
+            {
+                ring_handle_recv(worker, ptr, &cqe);
+            }
+            else if (tag == TAG_SEND)
+            {
+                SendOp *op = ptr;
+                op->session->sends--;
+                free(op);
+            }
+            else if (tag == TAG_WAKE)
+            {
+                if (cqe.res < 0)
+                {
+                    errno = -cqe.res;
+                    perror("eventfd read failed");
+                }
+                start_queued_matches(worker);
+                ring_arm_wake(worker);
+            }
+            else if (tag == TAG_PROVIDE && cqe.res < 0)
+            {
+                errno = -cqe.res;
+                perror("provide buffers failed");
+            }
+        }
+        if (now_us() - last_sweep_us >= 1000000L)
+        {
+            drop_idle_sessions(worker);
+            last_sweep_us = now_us();
+        }
+    }
+}
+
+// Returns NULL once the worker runs on io_uring, otherwise why it cannot.
+const char *ring_worker_init(Worker *worker)
+{
+    const char *reason = ring_init(&worker->ring, RING_ENTRIES);
+    if (reason != NULL)
+    {
+        return reason;
+    }
+    worker->buffers = malloc((size_t)RECV_BUFFERS * RECV_BUFFER_SIZE);
+    if (worker->buffers == NULL)
+    {
+        close(worker->ring.fd);
+        worker->ring.fd = -1;
+        return "no memory for receive buffers";
+    }
+    return NULL;
+}
+#endif
+
+void *acceptor_main(void *arg)
+{
+    Acceptor *acceptor = arg;
+#ifdef USE_IO_URING
+    IoRing ring;
+    const char *reason = ring_init(&ring, 8);
+    if (reason == NULL)
+    {
+        ring_accept_loop(acceptor, &ring);
+        return NULL;
+    }
+    printf("[Server] Port %d: %s, accepting with accept().\n", ports[acceptor->port_index], reason);
+#endif
+    for (;;)
+    {
+        int conn_fd = accept(acceptor->listen_fd, NULL, NULL);
+        if (conn_fd < 0)
+        {
+            // Out of descriptors or memory; give closing matches a moment instead of spinning
+            perror("accept failed");
+            usleep(ACCEPT_BACKOFF_US);
+            continue;
+        }
+        admit_client(acceptor, conn_fd);
+    }
+    return NULL;
+}
+
+void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    long last_sweep_us = now_us();
+
+    current_worker = worker;
+#ifdef USE_IO_URING
+    const char *reason = ring_worker_init(worker);
+    if (reason == NULL)
+    {
+        ring_worker_loop(worker);
+        return NULL;
+    }
+    printf("[Server] Worker %d: %s, using epoll.\n", worker->id, reason);
+#endif
+    for (;;)
+    {
+        count_syscalls(1);
+        int count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 1000);
+        if (count < 0 && errno != EINTR)
+        {
+            perror("epoll_wait failed");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            // The match queue's eventfd is registered with a NULL session
+            if (events[i].data.ptr == NULL)
+            {
+                count_syscalls(1);
+                queue_wait(&worker->matches);
+                start_queued_matches(worker);
+            }
+            else
+            {
+                read_turn(worker, events[i].data.ptr);
+            }
+        }
+        if (now_us() - last_sweep_us >= 1000000L)
+        {
+            drop_idle_sessions(worker);
+            last_sweep_us = now_us();
+        }
+    }
+    return NULL;
+}
+
+// Hands a pair to the least-loaded worker. Returns how long the earlier of the
+// two players waited, or -1 if the match had to be dropped.
+long dispatch_match(Ticket players[2], unsigned long match_id)
+{
+    Worker *target = &workers[0];
+    for (int i = 1; i < WORKER_COUNT; i++)
+    {
+        if (atomic_load(&workers[i].load) < atomic_load(&target->load))
+        {
+            target = &workers[i];
+        }
+    }
+
+    long waited = players[0].enqueued_us < players[1].enqueued_us ? players[0].enqueued_us : players[1].enqueued_us;
+    Ticket match = {.id = match_id, .fds = {players[0].fds[0], players[1].fds[0]}, .enqueued_us = now_us()};
+
+    atomic_fetch_add(&target->load, 1);
+    if (queue_push(&target->matches, &match) < 0)
+    {
+        atomic_fetch_sub(&target->load, 1);
+        printf("[Server] Worker %d is full, dropping match %lu.\n", target->id, match_id);
+        close(match.fds[0]);
+        close(match.fds[1]);
+        return -1;
+    }
+    printf("[Server] Match %lu: time_to_match_us=%ld queue_depth=%zu,%zu worker=%d load=%d\n",
+           match_id, match.enqueued_us - waited, queue_depth(&lobby[0]), queue_depth(&lobby[1]),
+           target->id, atomic_load(&target->load));
+    return match.enqueued_us - waited;
+}
+
+// One metrics line: lobby depth per port (including the client held for
+// pairing), then queued matches and load (queued plus running) per worker,
+// then the syscalls the workers have made and the moves they have handled
+// since startup.
+void print_metrics(MatchStats *stats, int has_waiting[2])
+{
+    long average = stats->interval_matches ? stats->total_wait_us / (long)stats->interval_matches : 0;
+
+    flockfile(stdout);
+    printf("[Server] metrics matches=%lu time_to_match_avg_us=%ld time_to_match_max_us=%ld lobby_depth=%zu,%zu",
+           stats->matches, average, stats->max_wait_us,
+           queue_depth(&lobby[0]) + has_waiting[0], queue_depth(&lobby[1]) + has_waiting[1]);
+    unsigned long syscalls = 0, moves = 0;
+    for (int i = 0; i < WORKER_COUNT; i++)
+    {
+        printf(" worker%d_queue=%zu worker%d_load=%d", i, queue_depth(&workers[i].matches), i, atomic_load(&workers[i].load));
+        syscalls += atomic_load_explicit(&workers[i].syscalls, memory_order_relaxed);
+        moves += atomic_load_explicit(&workers[i].moves, memory_order_relaxed);
+    }
+    printf(" worker_syscalls=%lu moves=%lu\n", syscalls, moves);
+    funlockfile(stdout);
+
+    stats->interval_matches = 0;
+    stats->total_wait_us = 0;
+    stats->max_wait_us = 0;
+}
+
+void run_matchmaking(int listen_fds[2])
+{
+    // A vanished client must not take the other matches down with it
+    signal(SIGPIPE, SIG_IGN);
+    // Long-running server: keep the log current even when redirected to a file
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int lobby_event_fd = make_eventfd();
+    for (int i = 0; i < 2; i++)
+    {
+        queue_init(&lobby[i], lobby_event_fd);
+    }
+    for (int i = 0; i < WORKER_COUNT; i++)
+    {
+        workers[i].id = i;
+        atomic_init(&workers[i].load, 0);
+        queue_init(&workers[i].matches, make_eventfd());
+        workers[i].sessions = NULL;
+        atomic_init(&workers[i].syscalls, 0);
+        atomic_init(&workers[i].moves, 0);
+#ifdef USE_IO_URING
+        workers[i].ring.fd = -1;
+        workers[i].active = NULL;
+        workers[i].retired = NULL;
+#endif
+        if ((workers[i].epoll_fd = epoll_create1(0)) < 0)
+        {
+            perror("epoll_create1 failed");
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        if (epoll_ctl(workers[i].epoll_fd, EPOLL_CTL_ADD, workers[i].matches.event_fd, &event) < 0)
+        {
+            perror("epoll_ctl failed");
+            exit(EXIT_FAILURE);
+        }
+        start_thread(&workers[i].thread, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        acceptors[i].listen_fd = listen_fds[i];
+        acceptors[i].port_index = i;
+        start_thread(&acceptors[i].thread, acceptor_main, &acceptors[i]);
+    }
+
+    // The oldest client of each port is held here until a partner arrives
+    Ticket waiting[2];
+    int has_waiting[2] = {0, 0};
+    unsigned long match_count = 0;
+    MatchStats stats = {0};
+    long next_report_us = now_us() + METRICS_INTERVAL_SEC * 1000000L;
+    for (;;)
+    {
+        long now = now_us();
+        if (now >= next_report_us)
+        {
+            print_metrics(&stats, has_waiting);
+            next_report_us = now + METRICS_INTERVAL_SEC * 1000000L;
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (!has_waiting[i])
+            {
+                has_waiting[i] = queue_pop(&lobby[i], &waiting[i]) == 0;
+            }
+            // Never pair a live client with one that already hung up
+            while (has_waiting[i] && !client_alive(waiting[i].fds[0]))
+            {
+                printf("[Server] Client on port %d left the lobby.\n", ports[i]);
+                close(waiting[i].fds[0]);
+                has_waiting[i] = queue_pop(&lobby[i], &waiting[i]) == 0;
+            }
+        }
+        if (has_waiting[0] && has_waiting[1])
+        {
+            long waited = dispatch_match(waiting, ++match_count);
+            if (waited >= 0)
+            {
+                stats.matches++;
+                stats.interval_matches++;
+                stats.total_wait_us += waited;
+                if (waited > stats.max_wait_us)
+                {
+                    stats.max_wait_us = waited;
+                }
+            }
+            has_waiting[0] = 0;
+            has_waiting[1] = 0;
+            continue;
+        }
+
+        // Both lobbies share one eventfd; wake up for new clients or the next report
+        struct pollfd lobby_poll = {.fd = lobby[0].event_fd, .events = POLLIN};
+        int timeout_ms = (next_report_us - now_us()) / 1000 + 1;
+        if (poll(&lobby_poll, 1, timeout_ms) > 0)
+        {
+            queue_wait(&lobby[0]);
+        }
+    }
+}
+#endif
+
+// Input validation. Everything below only reads the parsed arguments and
+// returns the protocol error to send, or NULL when the command is valid, so a
+// rejected command never touches a board.
+
+// Parses the numbers in input_str into args. Parsing stops once more than
+// MAX_ARGS have been seen; no command takes that many, so the count alone
+// rejects it without scanning the rest of the input.
+int parse_arguments(const char *input_str, int args[MAX_ARGS])
+{
+    int count = 0;
+    const char *ptr = input_str;
+
+    while (*ptr && !isdigit(*ptr))
+    {
+        ptr++;
+    }
+
+    while (*ptr && count <= MAX_ARGS)
+    {
+        int num = 0;
+        while (*ptr && isdigit(*ptr))
+        {
+            // Saturate instead of overflowing; anything this large is out of range anyway
+            if (num < BUFFER_SIZE)
+            {
+                num = num * 10 + (*ptr - '0');
+            }
+            ptr++;
+        }
+        if (count < MAX_ARGS)
+        {
+            args[count] = num;
+        }
+        count++;
+        while (*ptr && !isdigit(*ptr))
+        {
+            ptr++;
+        }
+    }
+    return count;
+}
+
+const char *validate_begin(int player, const int *args, int arg_count)
+{
+    if (player == 2)
+    {
+        return arg_count == 0 ? NULL : "E 200";
+    }
+    if (arg_count != 2)
+    {
+        return "E 200";
+    }
+    if (args[0] < MIN_SIZE || args[0] > MAX_SIZE || args[1] < MIN_SIZE || args[1] > MAX_SIZE)
+    {
+        return "E 200";
+    }
+    return NULL;
+}
+
+// Locates the first filled cell of a shape, scanning column by column. Pieces
+// are positioned on the board by this cell.
+void find_anchor(int shape[SHIP_SIZE][SHIP_SIZE], int *row_pos, int *col_pos)
+{
+    *row_pos = 0;
+    *col_pos = 0;
+    for (int i = 0; i < SHIP_SIZE; i++)
+    {
+        for (int j = 0; j < SHIP_SIZE; j++)
+        {
+            if (shape[j][i] == 1)
+            {
+                *row_pos = j;
+                *col_pos = i;
+                return;
+            }
+        }
+    }
+}
+
+const char *validate_init(const int *args, int arg_count, int width, int height)
+{
+    if (arg_count != MAX_ARGS)
+    {
+        return "E 201";
+    }
+
+    for (int i = 0; i < PIECE_COUNT; i++)
+    {
+        int type = args[i * 4];
+        int rotation = args[i * 4 + 1];
+        int col = args[i * 4 + 2];
+        int row = args[i * 4 + 3];
+
+        if (type < 1 || type > NUM_SHAPES)
+        {
+            return "E 300";
+        }
+        if (rotation < 1 || rotation > ROTATIONS)
+        {
+            return "E 301";
+        }
+        if (row < 0 || row >= height || col < 0 || col >= width)
+        {
+            return "E 302";
+        }
+    }
+
+    // Check fit and overlap against a scratch occupancy mask, one bit per column
+    uint32_t occupied[MAX_SIZE] = {0};
+    for (int i = 0; i < PIECE_COUNT; i++)
+    {
+        int(*shape)[SHIP_SIZE] = ship_shapes[args[i * 4] - 1][args[i * 4 + 1] - 1];
+        int col = args[i * 4 + 2];
+        int row = args[i * 4 + 3];
+        int row_pos, col_pos;
+        find_anchor(shape, &row_pos, &col_pos);
+
+        for (int j = 0; j < SHIP_SIZE; j++)
+        {
+            for (int k = 0; k < SHIP_SIZE; k++)
+            {
+                if (!shape[j][k])
+                {
+                    continue;
+                }
+                int board_row = row - row_pos + j;
+                int board_col = col - col_pos + k;
+                if (board_row < 0 || board_row >= height || board_col < 0 || board_col >= width)
+                {
+                    return "E 302";
+                }
+                if (occupied[board_row] & (1u << board_col))
+                {
+                    return "E 303";
+                }
+                occupied[board_row] |= 1u << board_col;
+            }
+        }
+    }
+    return NULL;
+}
+
+const char *validate_shot(const int *args, int arg_count, int width, int height)
+{
+    if (arg_count != 2)
+    {
+        return "E 202";
+    }
+    int row = args[0];
+    int col = args[1];
+    if (col < 0 || col >= width || row < 0 || row >= height)
+    {
+        return "E 400";
+    }
+    return NULL;
+}
+
+void rotate_90_clockwise(int shape[SHIP_SIZE][SHIP_SIZE], int rotatedShape[SHIP_SIZE][SHIP_SIZE])
+{
+    for (int i = 0; i < SHIP_SIZE; i++)
+    {
+        for (int j = 0; j < SHIP_SIZE; j++)
+        {
+            rotatedShape[j][SHIP_SIZE - 1 - i] = shape[i][j];
+        }
+    }
+}
+
+void reset_board(PlayerBoard *board)
+{
+    memset(board, 0, sizeof(*board));
+    board->ships_remaining = PIECE_COUNT;
+}
+
+void place_cell(PlayerBoard *board, int row, int col, int ship_id)
+{
+    board->cells[row][col] = ship_id;
+    board->cells_left[ship_id]++;
+}
+
+ShotResult fire_shot(PlayerBoard *board, int row, int col)
+{
+    uint8_t cell = board->cells[row][col];
+
+    if (cell == CELL_MISS || (cell & CELL_HIT))
+    {
+        return SHOT_REPEAT;
+    }
+    if (cell == CELL_EMPTY)
+    {
+        board->cells[row][col] = CELL_MISS;
+        return SHOT_MISS;
+    }
+
+    board->cells[row][col] = cell | CELL_HIT;
+    if (--board->cells_left[cell & CELL_SHIP_MASK] > 0)
+    {
+        return SHOT_HIT;
+    }
+    board->ships_remaining--;
+    return SHOT_SUNK;
+}
+
+// Room for a full frame (glyph plus space per cell, boards separated by two
+// tabs) or a worst-case diff where every cell needs its own cursor move.
+#define FRAME_SIZE (2 * MAX_SIZE * MAX_SIZE * 12 + 32)
+
+typedef struct
+{
+    char frame[FRAME_SIZE];
+    uint8_t shown[2][MAX_SIZE][MAX_SIZE];
+    int drawn_width;
+    int drawn_height;
+} Renderer;
+
+static __thread Renderer renderer;
+
+char cell_glyph(uint8_t cell)
+{
+    if (cell & CELL_HIT)
+    {
+        return 'X';
+    }
+    if (cell == CELL_MISS)
+    {
+        return 'O';
+    }
+    if (cell == CELL_EMPTY)
+    {
+        return '-';
+    }
+    return '0' + cell;
+}
+
+void write_frame(const char *frame, int len)
+{
+    // Flush pending printf output so the frame lands in order
+    fflush(stdout);
+    while (len > 0)
+    {
+        int written = write(STDOUT_FILENO, frame, len);
+        if (written <= 0)
+        {
+            return;
+        }
+        frame += written;
+        len -= written;
+    }
+}
+
+int format_row(char *out, PlayerBoard *board, int row, int width)
+{
+    int len = 0;
+    for (int j = 0; j < width; j++)
+    {
+        out[len++] = cell_glyph(board->cells[row][j]);
+        out[len++] = ' ';
+    }
+    return len;
+}
+
+void clamp_size(int *width, int *height)
+{
+    if (*width > MAX_SIZE)
+    {
+        *width = MAX_SIZE;
+    }
+    if (*height > MAX_SIZE)
+    {
+        *height = MAX_SIZE;
+    }
+}
+
+// Places a piece given as {type, rotation, col, row}; it must already have
+// passed validate_init.
+void place_ship(PlayerBoard *board, const int *piece, int ship_id)
+{
+    int(*shape)[SHIP_SIZE] = ship_shapes[piece[0] - 1][piece[1] - 1];
+    int col = piece[2];
+    int row = piece[3];
+    int row_pos, col_pos;
+    find_anchor(shape, &row_pos, &col_pos);
+
+    for (int j = 0; j < SHIP_SIZE; j++)
+    {
+        for (int k = 0; k < SHIP_SIZE; k++)
+        {
+            if (shape[j][k])
+            {
+                place_cell(board, row - row_pos + j, col - col_pos + k, ship_id);
+            }
+        }
+    }
+}
+
+void print_board(PlayerBoard *board, int width, int height)
+{
+    char *out = renderer.frame;
+    int len = 0;
+
+    clamp_size(&width, &height);
+    for (int i = 0; i < height; i++)
+    {
+        len += format_row(out + len, board, i, width);
+        out[len++] = '\n';
+    }
+    out[len++] = '\n';
+    write_frame(out, len);
+}
+
+#ifdef ANSI_RENDER
+// Screen column (1-based) where a board starts, following the tab stops after board 0.
+int board_column(int board, int width)
+{
+    if (board == 0)
+    {
+        return 1;
+    }
+    int x = 2 * width;
+    x = (x / 8 + 1) * 8 + 8;
+    return x + 1;
+}
+
+// Redraw only the cells that changed since the previous frame. The boards stay
+// pinned to the top of the screen and log output scrolls in the region below.
+int format_diff(char *out, PlayerBoard boards[2], int width, int height)
+{
+    int len = 0;
+
+    len += sprintf(out + len, "\0337");
+    for (int board = 0; board < 2; board++)
+    {
+        for (int i = 0; i < height; i++)
+        {
+            for (int j = 0; j < width; j++)
+            {
+                uint8_t cell = boards[board].cells[i][j];
+                if (cell != renderer.shown[board][i][j])
+                {
+                    len += sprintf(out + len, "\033[%d;%dH%c", i + 1, board_column(board, width) + 2 * j, cell_glyph(cell));
+                    renderer.shown[board][i][j] = cell;
+                }
+            }
+        }
+    }
+    len += sprintf(out + len, "\0338");
+    return len;
+}
+
+// Hand the whole screen back to the terminal when the server exits.
+void reset_scroll_region()
+{
+    write_frame("\033[r", 3);
+}
+#endif
+
+void print_boards(PlayerBoard boards[2], int width, int height)
+{
+    char *out = renderer.frame;
+    int len = 0;
+
+    clamp_size(&width, &height);
+#ifdef ANSI_RENDER
+    if (width > 0 && isatty(STDOUT_FILENO))
+    {
+        if (width == renderer.drawn_width && height == renderer.drawn_height)
+        {
+            write_frame(out, format_diff(out, boards, width, height));
+            return;
+        }
+        if (!renderer.drawn_width)
+        {
+            atexit(reset_scroll_region);
+        }
+        memcpy(renderer.shown[0], boards[0].cells, sizeof(renderer.shown[0]));
+        memcpy(renderer.shown[1], boards[1].cells, sizeof(renderer.shown[1]));
+        renderer.drawn_width = width;
+        renderer.drawn_height = height;
+        len += sprintf(out, "\033[r\033[H\033[2J");
+    }
+#endif
+    for (int i = 0; i < height; i++)
+    {
+        for (int board = 0; board < 2; board++)
+        {
+            len += format_row(out + len, &boards[board], i, width);
+            out[len++] = '\t';
+            out[len++] = '\t';
+        }
+        out[len++] = '\n';
+    }
+    out[len++] = '\n';
+#ifdef ANSI_RENDER
+    if (renderer.drawn_width)
+    {
+        // Keep the boards fixed and scroll the log below them
+        len += sprintf(out + len, "\033[%dr\033[%d;1H", height + 2, height + 2);
+    }
+#endif
+    write_frame(out, len);
+}